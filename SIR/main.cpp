@@ -5,26 +5,30 @@
 #include <ctime>
 #include <tcl.h>
 #include <tk.h>
-#include <atomic>
-#include <thread>
-#include <mutex>
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iomanip>
 #include <unistd.h> // Para getcwd
 
-// Estructura para representar una persona
-struct Person
+#include "../core/simulation.h"
+#include "../core/tk_loop.h"
+
+// Columnas de la población (una por atributo de cada persona)
+enum PersonColumn
 {
-  double x, y; // Posición
-  char state;  // 'S' para susceptible, 'I' para infectado, 'R' para recuperado, 'D' para fallecido
+  X,     // Posición
+  Y,
+  Health // 'S' para susceptible, 'I' para infectado, 'R' para recuperado, 'D' para fallecido
 };
 
-// Estructura para contener la población y el intérprete de Tcl
-struct SimulationData
+typedef sim::AgentStorage<double, double, char> Population;
+
+// Número de personas en cada estado tras un paso de tiempo
+struct Counts
 {
-  std::vector<Person> people;
-  Tcl_Interp *interp;
+  int t;
+  int susceptible, infected, recovered, dead;
 };
 
 // Parámetros del modelo SIR
@@ -32,125 +36,194 @@ const double dt = 0.1;               // Paso de tiempo
 const int numPeople = 100;           // Número de personas
 const double infectionRadius = 25.0; // Radio de infección
 
-// Variables globales para controlar la simulación
-std::atomic<bool> simulationRunning(false);
-std::mutex mtx;
+// Tamaño de los bloques de personas que procesa cada hilo
+const std::size_t peopleGrain = 64;
+
+// Estructura para contener la población, el planificador de fases y el intérprete de Tcl
+struct SimulationData
+{
+  Population people;
+  std::vector<char> newStates;
+  std::vector<std::size_t> infectedIds; // Personas infectadas al inicio del paso
+  double beta, gamma_, mu;
+  Counts counts;
+
+  sim::ThreadPool pool;
+  std::uint64_t runSeed;   // Semilla de la ejecución actual
+  std::uint64_t runNumber; // Ejecuciones inicializadas hasta ahora
+  sim::Scheduler scheduler;
+  Tcl_Interp *interp;
+
+  SimulationData() : beta(0), gamma_(0), mu(0), counts(), runSeed(0), runNumber(0), interp(NULL) {}
+};
+
+// Semilla fija: como con rand() sin srand(), cada ejecución del programa produce los mismos archivos
+const std::uint64_t baseSeed = 1;
+
+// Sorteos de cada persona en un paso de tiempo. Los números aleatorios dependen solo de
+// (ejecución, paso, persona, sorteo), así que los resultados no cambian con el número de hilos
+// ni con el reparto del trabajo entre ellos.
+enum Draw
+{
+  DrawRecovery,
+  DrawDeath,
+  DrawMoveX,
+  DrawMoveY,
+  DrawInfection // Más uno por cada persona infectada cercana ya sorteada
+};
+
+const std::uint32_t drawsPerStep = DrawInfection + numPeople;
+
+inline std::uint32_t personRandom(const SimulationData &data, std::uint64_t step, std::size_t person, std::uint32_t draw)
+{
+  return static_cast<std::uint32_t>(sim::counterRandom(data.runSeed, static_cast<std::uint32_t>(person),
+                                                       static_cast<std::uint32_t>(step * drawsPerStep + draw)));
+}
+
+// Número entero uniforme en [0, 100)
+inline std::uint32_t personPercent(const SimulationData &data, std::uint64_t step, std::size_t person, std::uint32_t draw)
+{
+  return sim::below(personRandom(data, step, person, draw), 100);
+}
 
 // Función para inicializar la población
 void initializePopulation(SimulationData &data, int initialInfected)
 {
+  data.runSeed = sim::mix64(baseSeed + data.runNumber++);
+  sim::Rng rng(data.runSeed);
   data.people.clear();
+  data.people.reserve(numPeople);
   for (int i = 0; i < numPeople; ++i)
   {
-    Person person;
-    person.x = rand() % 500;
-    person.y = rand() % 500;
-    person.state = (i < initialInfected) ? 'I' : 'S'; // Inicializar con el número especificado de personas infectadas
-    data.people.push_back(person);
+    // Inicializar con el número especificado de personas infectadas
+    data.people.push_back(rng.below(500), rng.below(500), (i < initialInfected) ? 'I' : 'S');
   }
+  data.scheduler.reset();
 }
 
-// Función para actualizar el estado de la población
-void updatePopulation(SimulationData &data, double beta, double gamma_, double mu, int &susceptibleCount, int &infectedCount, int &recoveredCount, int &deadCount)
+// Fases de un paso de tiempo, en el orden en que se ejecutan
+void setupScheduler(SimulationData &data)
 {
-  susceptibleCount = 0;
-  infectedCount = 0;
-  recoveredCount = 0;
-  deadCount = 0;
-
   // Primero, procesar las transiciones de estado
-  std::vector<char> newStates(data.people.size());
-  for (size_t i = 0; i < data.people.size(); ++i)
-  {
-    newStates[i] = data.people[i].state;
-    if (data.people[i].state == 'I')
-    {
-      // Recuperación
-      if ((rand() % 100) < (gamma_ * 100))
+  data.scheduler.addPhase("transitions", [&data](std::uint64_t step)
+                          {
+    const std::vector<char> &state = data.people.column<Health>();
+    data.newStates.resize(state.size());
+    data.pool.parallelFor(state.size(), peopleGrain, [&](std::size_t begin, std::size_t end, unsigned)
+                          {
+      for (std::size_t i = begin; i < end; ++i)
       {
-        newStates[i] = 'R';
-      }
-      // Muerte
-      else if ((rand() % 100) < (mu * 100))
+        data.newStates[i] = state[i];
+        if (state[i] == 'I')
+        {
+          // Recuperación
+          if (personPercent(data, step, i, DrawRecovery) < (data.gamma_ * 100))
+          {
+            data.newStates[i] = 'R';
+          }
+          // Muerte
+          else if (personPercent(data, step, i, DrawDeath) < (data.mu * 100))
+          {
+            data.newStates[i] = 'D';
+          }
+        }
+      } }); });
+
+  // Luego, procesar las infecciones (solo contra las personas infectadas al inicio del paso)
+  data.scheduler.addPhase("infections", [&data](std::uint64_t step)
+                          {
+    const std::vector<double> &xs = data.people.column<X>();
+    const std::vector<double> &ys = data.people.column<Y>();
+    const std::vector<char> &state = data.people.column<Health>();
+
+    data.infectedIds.clear();
+    for (std::size_t j = 0; j < state.size(); ++j)
+    {
+      if (state[j] == 'I')
       {
-        newStates[i] = 'D';
+        data.infectedIds.push_back(j);
       }
     }
-  }
 
-  // Luego, procesar las infecciones
-  for (size_t i = 0; i < data.people.size(); ++i)
-  {
-    if (newStates[i] == 'S' || newStates[i] == 'R')
-    {
-      for (const auto &other : data.people)
+    const double radius2 = infectionRadius * infectionRadius;
+    data.pool.parallelFor(state.size(), peopleGrain, [&](std::size_t begin, std::size_t end, unsigned)
+                          {
+      for (std::size_t i = begin; i < end; ++i)
       {
-        if (other.state == 'I')
+        if (data.newStates[i] == 'S' || data.newStates[i] == 'R')
         {
-          double distance = std::sqrt(std::pow(data.people[i].x - other.x, 2) + std::pow(data.people[i].y - other.y, 2));
-          if (distance < infectionRadius)
+          std::uint32_t draw = DrawInfection;
+          for (std::size_t j : data.infectedIds)
           {
-            if ((rand() % 100) < (beta * 100))
+            const double dx = xs[i] - xs[j];
+            const double dy = ys[i] - ys[j];
+            if (dx * dx + dy * dy < radius2)
             {
-              newStates[i] = 'I';
-              break;
+              if (personPercent(data, step, i, draw++) < (data.beta * 100))
+              {
+                data.newStates[i] = 'I';
+                break;
+              }
             }
           }
         }
-      }
-    }
-  }
+      } }); });
 
   // Aplicar los nuevos estados
-  for (size_t i = 0; i < data.people.size(); ++i)
-  {
-    data.people[i].state = newStates[i];
-  }
+  data.scheduler.addPhase("apply", [&data](std::uint64_t)
+                          { data.people.column<Health>().swap(data.newStates); });
 
   // Movimiento aleatorio con distribución uniforme
-  for (auto &person : data.people)
-  {
-    if (person.state != 'D')
-    {                                 // Solo las personas vivas se mueven
-      person.x += (rand() % 51 - 25); // Movimiento en x en el rango [-15, 15]
-      person.y += (rand() % 51 - 25); // Movimiento en y en el rango [-15, 15]
-      if (person.x < 0)
-        person.x = 0;
-      if (person.x > 500)
-        person.x = 500;
-      if (person.y < 0)
-        person.y = 0;
-      if (person.y > 500)
-        person.y = 500;
-    }
-  }
+  data.scheduler.addPhase("movement", [&data](std::uint64_t step)
+                          {
+    std::vector<double> &xs = data.people.column<X>();
+    std::vector<double> &ys = data.people.column<Y>();
+    const std::vector<char> &state = data.people.column<Health>();
+    data.pool.parallelFor(state.size(), peopleGrain, [&](std::size_t begin, std::size_t end, unsigned)
+                          {
+      for (std::size_t i = begin; i < end; ++i)
+      {
+        if (state[i] != 'D')
+        {                                            // Solo las personas vivas se mueven
+          xs[i] += static_cast<int>(sim::below(personRandom(data, step, i, DrawMoveX), 51)) - 25; // Movimiento en x en el rango [-25, 25]
+          ys[i] += static_cast<int>(sim::below(personRandom(data, step, i, DrawMoveY), 51)) - 25; // Movimiento en y en el rango [-25, 25]
+          xs[i] = std::min(500.0, std::max(0.0, xs[i]));
+          ys[i] = std::min(500.0, std::max(0.0, ys[i]));
+        }
+      } }); });
 
   // Contar el número de personas en cada estado
-  for (const auto &person : data.people)
-  {
-    switch (person.state)
+  data.scheduler.addPhase("count", [&data](std::uint64_t step)
+                          {
+    Counts counts = {static_cast<int>(step), 0, 0, 0, 0};
+    for (char state : data.people.column<Health>())
     {
-    case 'S':
-      susceptibleCount++;
-      break;
-    case 'I':
-      infectedCount++;
-      break;
-    case 'R':
-      recoveredCount++;
-      break;
-    case 'D':
-      deadCount++;
-      break;
+      counts.susceptible += state == 'S';
+      counts.infected += state == 'I';
+      counts.recovered += state == 'R';
+      counts.dead += state == 'D';
     }
-  }
+    data.counts = counts; });
+}
+
+// Función para actualizar el estado de la población
+void updatePopulation(SimulationData &data, double beta, double gamma_, double mu, int &susceptibleCount, int &infectedCount, int &recoveredCount, int &deadCount)
+{
+  data.beta = beta;
+  data.gamma_ = gamma_;
+  data.mu = mu;
+  data.scheduler.step();
+
+  susceptibleCount = data.counts.susceptible;
+  infectedCount = data.counts.infected;
+  recoveredCount = data.counts.recovered;
+  deadCount = data.counts.dead;
 }
 
 // Función para actualizar la GUI
-void updateGUI(void *clientData)
+void updateGUI(SimulationData &data, const sim::TkLoop &loop)
 {
-  SimulationData *data = reinterpret_cast<SimulationData *>(clientData);
-  Tcl_Interp *interp = data->interp;
+  Tcl_Interp *interp = data.interp;
 
   // Obtener los valores de beta, gamma_ y mu desde los datos de la simulación
   double beta = 0.9;   // Valor por defecto, debería ser actualizado
@@ -158,18 +231,21 @@ void updateGUI(void *clientData)
   double mu = 0.0;     // Valor por defecto, debería ser actualizado
 
   // Actualizar la población
-  if (simulationRunning)
+  if (loop.isRunning())
   {
     int susceptibleCount, infectedCount, recoveredCount, deadCount;
-    updatePopulation(*data, beta, gamma_, mu, susceptibleCount, infectedCount, recoveredCount, deadCount);
+    updatePopulation(data, beta, gamma_, mu, susceptibleCount, infectedCount, recoveredCount, deadCount);
   }
 
   // Actualizar la GUI
+  const std::vector<double> &xs = data.people.column<X>();
+  const std::vector<double> &ys = data.people.column<Y>();
+  const std::vector<char> &state = data.people.column<Health>();
   Tcl_Eval(interp, ".canvas delete all");
-  for (const auto &person : data->people)
+  for (std::size_t i = 0; i < data.people.size(); ++i)
   {
     std::string color;
-    switch (person.state)
+    switch (state[i])
     {
     case 'S':
       color = "blue";
@@ -184,47 +260,33 @@ void updateGUI(void *clientData)
       color = "gray";
       break;
     }
-    std::string command = ".canvas create oval " + std::to_string(person.x - 5) + " " + std::to_string(person.y - 5) + " " +
-                          std::to_string(person.x + 5) + " " + std::to_string(person.y + 5) + " -fill " + color;
+    std::string command = ".canvas create oval " + std::to_string(xs[i] - 5) + " " + std::to_string(ys[i] - 5) + " " +
+                          std::to_string(xs[i] + 5) + " " + std::to_string(ys[i] + 5) + " -fill " + color;
     Tcl_Eval(interp, command.c_str());
 
     // Dibujar el radio de infección para las personas infectadas
-    if (person.state == 'I')
+    if (state[i] == 'I')
     {
-      std::string radiusCommand = ".canvas create oval " + std::to_string(person.x - infectionRadius) + " " +
-                                  std::to_string(person.y - infectionRadius) + " " +
-                                  std::to_string(person.x + infectionRadius) + " " +
-                                  std::to_string(person.y + infectionRadius) + " -outline red";
+      std::string radiusCommand = ".canvas create oval " + std::to_string(xs[i] - infectionRadius) + " " +
+                                  std::to_string(ys[i] - infectionRadius) + " " +
+                                  std::to_string(xs[i] + infectionRadius) + " " +
+                                  std::to_string(ys[i] + infectionRadius) + " -outline red";
       Tcl_Eval(interp, radiusCommand.c_str());
     }
   }
-
-  // Programar la siguiente actualización
-  Tcl_CreateTimerHandler(100, updateGUI, clientData);
-}
-
-// Función para iniciar la simulación
-int startSimulation(ClientData clientData, Tcl_Interp *interp, int argc, const char *argv[])
-{
-  simulationRunning = true;
-  Tcl_SetResult(interp, const_cast<char *>("Simulation Running"), TCL_STATIC);
-  return TCL_OK;
-}
-
-// Función para detener la simulación
-int stopSimulation(ClientData clientData, Tcl_Interp *interp, int argc, const char *argv[])
-{
-  simulationRunning = false;
-  Tcl_SetResult(interp, const_cast<char *>("Simulation Stopped"), TCL_STATIC);
-  return TCL_OK;
 }
 
 // Función para ejecutar la simulación sin GUI
 void runSimulationWithoutGUI(SimulationData &data, int initialInfected, double **datalhs, int nvar, int nruns)
 {
+  // Los conteos de cada paso se escriben en un hilo aparte
+  sim::OutputPipeline<Counts> output(128);
+  sim::TimingStats runTimes;
+
   // Ejecutar la simulación para cada conjunto de parámetros
   for (int run = 1; run <= nruns; ++run)
   {
+    sim::ScopedTimer timer(runTimes);
     double beta = datalhs[0][run];
     double gamma_ = datalhs[1][run];
     double mu = datalhs[2][run];
@@ -235,28 +297,37 @@ void runSimulationWithoutGUI(SimulationData &data, int initialInfected, double *
     // Crear un archivo para guardar los resultados de esta ejecución
     std::ostringstream filename;
     filename << std::setw(4) << std::setfill('0') << run;
-    std::ofstream outfile(filename.str());
-    if (!outfile)
+    std::shared_ptr<std::ofstream> outfile(new std::ofstream(filename.str()));
+    if (!*outfile)
     {
       std::cerr << "Error: No se pudo crear el archivo " << filename.str() << std::endl;
       return;
     }
+    output.open([outfile](const Counts *counts, std::size_t n)
+                {
+      // Guardar los resultados en el archivo
+      for (std::size_t k = 0; k < n; ++k)
+      {
+        *outfile << counts[k].t << "\t" << counts[k].susceptible << "\t" << counts[k].infected << "\t" << counts[k].recovered << "\t" << counts[k].dead << "\n";
+      } });
 
     // Ejecutar la simulación para el conjunto de parámetros actual
     for (int t = 0; t <= 100; ++t)
     { // Simulación de 100 pasos de tiempo
       int susceptibleCount, infectedCount, recoveredCount, deadCount;
       updatePopulation(data, beta, gamma_, mu, susceptibleCount, infectedCount, recoveredCount, deadCount);
-
-      // Guardar los resultados en el archivo
-      outfile << t << "\t" << susceptibleCount << "\t" << infectedCount << "\t" << recoveredCount << "\t" << deadCount << "\n";
+      output.push(data.counts);
     }
 
-    outfile.close();
+    output.close();
 
     // Imprimir los resultados para el conjunto de parámetros actual
     std::cout << "Run " << run << ": beta=" << beta << ", gamma_=" << gamma_ << ", mu=" << mu << std::endl;
   }
+
+  // Tiempos de la última ejecución por fase y tiempo medio por ejecución
+  data.scheduler.report(std::cout);
+  std::cout << "Tiempo medio por ejecucion: " << runTimes.mean() * 1e3 << " ms" << std::endl;
 }
 
 // Función principal
@@ -270,6 +341,7 @@ int main(int argc, char *argv[])
 
   // Crear datos de la simulación
   SimulationData data;
+  setupScheduler(data);
 
   // Leer el archivo lhsmatrix y ejecutar la simulación para cada conjunto de parámetros
   std::ifstream lhsmatrix("lhsmatrix", std::ios::in);
@@ -324,9 +396,9 @@ int main(int argc, char *argv[])
     // Inicializar la población con un número específico de personas infectadas
     initializePopulation(data, initialInfected);
 
-    // Crear comandos Tcl para actualizar la GUI
-    Tcl_CreateCommand(interp, "startSimulation", startSimulation, reinterpret_cast<void *>(&data), NULL);
-    Tcl_CreateCommand(interp, "stopSimulation", stopSimulation, reinterpret_cast<void *>(&data), NULL);
+    // Crear comandos Tcl para iniciar y detener la simulación
+    sim::TkLoop loop(interp, 100);
+    loop.addControlCommands("startSimulation", "stopSimulation", "Simulation Running", "Simulation Stopped");
 
     // Configurar la GUI
     Tcl_Eval(interp, "wm title . {SIR Model Simulation}");
@@ -335,11 +407,12 @@ int main(int argc, char *argv[])
     Tcl_Eval(interp, "button .stop -text {Stop Simulation} -command {stopSimulation}");
     Tcl_Eval(interp, "pack .start .stop .canvas");
 
-    // Programar la primera actualización de la GUI
-    Tcl_CreateTimerHandler(100, updateGUI, reinterpret_cast<void *>(&data));
+    // Programar las actualizaciones de la GUI
+    loop.schedule([&data, &loop]()
+                  { updateGUI(data, loop); });
 
     // Iniciar el bucle principal de Tk
-    Tk_MainLoop();
+    loop.mainLoop();
   }
 
   // Liberar memoria de la matriz dinámica
@@ -350,4 +423,4 @@ int main(int argc, char *argv[])
   delete[] datalhs;
 
   return 0;
-}
\ No newline at end of file
+}
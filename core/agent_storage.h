@@ -0,0 +1,145 @@
+#ifndef SIM_AGENT_STORAGE_H
+#define SIM_AGENT_STORAGE_H
+
+#include <cstddef>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+namespace detail {
+
+// Applies an operation to every column of a tuple of vectors (C++11 has no
+// std::index_sequence, so the recursion is spelled out)
+template <std::size_t I, std::size_t N>
+struct ColumnLoop {
+    template <typename Tuple, typename Fn>
+    static void apply(Tuple& columns, Fn& fn) {
+        fn(std::get<I>(columns));
+        ColumnLoop<I + 1, N>::apply(columns, fn);
+    }
+
+    template <typename Tuple, typename Values>
+    static void push(Tuple& columns, const Values& values) {
+        std::get<I>(columns).push_back(std::get<I>(values));
+        ColumnLoop<I + 1, N>::push(columns, values);
+    }
+
+    template <typename Tuple>
+    static void moveLast(Tuple& columns, std::size_t to) {
+        std::get<I>(columns)[to] = std::move(std::get<I>(columns).back());
+        ColumnLoop<I + 1, N>::moveLast(columns, to);
+    }
+};
+
+template <std::size_t N>
+struct ColumnLoop<N, N> {
+    template <typename Tuple, typename Fn>
+    static void apply(Tuple&, Fn&) {}
+
+    template <typename Tuple, typename Values>
+    static void push(Tuple&, const Values&) {}
+
+    template <typename Tuple>
+    static void moveLast(Tuple&, std::size_t) {}
+};
+
+struct ReserveColumn {
+    std::size_t count;
+    template <typename Column>
+    void operator()(Column& column) { column.reserve(count); }
+};
+
+struct ResizeColumn {
+    std::size_t count;
+    template <typename Column>
+    void operator()(Column& column) { column.resize(count); }
+};
+
+struct ClearColumn {
+    template <typename Column>
+    void operator()(Column& column) { column.clear(); }
+};
+
+struct PopColumn {
+    template <typename Column>
+    void operator()(Column& column) { column.pop_back(); }
+};
+
+} // namespace detail
+
+// Structure-of-arrays agent container: one std::vector per attribute, all of
+// the same length. Kernels that only touch some attributes stream through
+// exactly those arrays. Columns are addressed by position, usually through a
+// model-specific enum:
+//
+//   enum { X, Y, Health };
+//   sim::AgentStorage<double, double, char> people;
+//   people.push_back(10.0, 20.0, 'S');
+//   std::vector<double>& xs = people.column<X>();
+template <typename... Columns>
+class AgentStorage {
+public:
+    typedef std::tuple<Columns...> Values;
+
+    template <std::size_t I>
+    struct ColumnType {
+        typedef typename std::tuple_element<I, Values>::type type;
+    };
+
+    template <std::size_t I>
+    std::vector<typename ColumnType<I>::type>& column() {
+        return std::get<I>(columns);
+    }
+
+    template <std::size_t I>
+    const std::vector<typename ColumnType<I>::type>& column() const {
+        return std::get<I>(columns);
+    }
+
+    std::size_t size() const {
+        return std::get<0>(columns).size();
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    void reserve(std::size_t count) {
+        detail::ReserveColumn op = {count};
+        detail::ColumnLoop<0, sizeof...(Columns)>::apply(columns, op);
+    }
+
+    void resize(std::size_t count) {
+        detail::ResizeColumn op = {count};
+        detail::ColumnLoop<0, sizeof...(Columns)>::apply(columns, op);
+    }
+
+    void clear() {
+        detail::ClearColumn op;
+        detail::ColumnLoop<0, sizeof...(Columns)>::apply(columns, op);
+    }
+
+    // Appends one agent and returns its index
+    std::size_t push_back(const Columns&... values) {
+        detail::ColumnLoop<0, sizeof...(Columns)>::push(columns, std::tie(values...));
+        return size() - 1;
+    }
+
+    // Removes agent i in O(1) by moving the last agent into its slot
+    void swapRemove(std::size_t i) {
+        if (i + 1 != size()) {
+            detail::ColumnLoop<0, sizeof...(Columns)>::moveLast(columns, i);
+        }
+        detail::PopColumn op;
+        detail::ColumnLoop<0, sizeof...(Columns)>::apply(columns, op);
+    }
+
+private:
+    std::tuple<std::vector<Columns>...> columns;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef SIM_OUTPUT_H
+#define SIM_OUTPUT_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+// Buffered output drained by a background thread. Records are appended to an
+// in-memory buffer; full buffers are handed to the writer thread, which passes
+// them to the sink, so the simulation never blocks on I/O unless the writer
+// falls behind by more than maxPending buffers.
+template <typename Record>
+class OutputPipeline {
+public:
+    // Called on the writer thread with consecutive records, in push order
+    typedef std::function<void(const Record*, std::size_t)> Sink;
+
+    explicit OutputPipeline(std::size_t bufferRecords = 1 << 16, std::size_t maxPending = 8)
+        : bufferRecords(std::max<std::size_t>(1, bufferRecords)), maxPending(maxPending), active(false), stopping(false) {}
+
+    ~OutputPipeline() {
+        close();
+    }
+
+    OutputPipeline(const OutputPipeline&) = delete;
+    OutputPipeline& operator=(const OutputPipeline&) = delete;
+
+    void open(const Sink& outputSink) {
+        close();
+        sink = outputSink;
+        stopping = false;
+        active = true;
+        current.clear();
+        current.reserve(bufferRecords);
+        writer = std::thread(&OutputPipeline::writerLoop, this);
+    }
+
+    bool isOpen() const {
+        return active;
+    }
+
+    void push(const Record& record) {
+        current.push_back(record);
+        if (current.size() >= bufferRecords) {
+            submit();
+        }
+    }
+
+    // Writes everything still buffered, stops the writer thread and releases the sink
+    void close() {
+        if (!active) {
+            return;
+        }
+        if (!current.empty()) {
+            submit();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        ready.notify_one();
+        writer.join();
+        active = false;
+        sink = Sink();
+        pending.clear();
+        spare.clear();
+    }
+
+private:
+    typedef std::vector<Record> Buffer;
+
+    std::size_t bufferRecords;
+    std::size_t maxPending;
+    Sink sink;
+    Buffer current;
+    std::vector<Buffer> pending;
+    std::vector<Buffer> spare;
+    std::thread writer;
+    std::mutex mtx;
+    std::condition_variable ready;
+    std::condition_variable drained;
+    bool active;
+    bool stopping;
+
+    void submit() {
+        std::unique_lock<std::mutex> lock(mtx);
+        drained.wait(lock, [this] { return pending.size() < maxPending; });
+        pending.push_back(std::move(current));
+        if (!spare.empty()) {
+            current = std::move(spare.back());
+            spare.pop_back();
+        } else {
+            current = Buffer();
+        }
+        current.clear();
+        current.reserve(bufferRecords);
+        ready.notify_one();
+    }
+
+    void writerLoop() {
+        std::vector<Buffer> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                ready.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty() && stopping) {
+                    return;
+                }
+                batch.swap(pending);
+            }
+            drained.notify_all();
+
+            for (auto& buffer : batch) {
+                sink(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto& buffer : batch) {
+                spare.push_back(std::move(buffer));
+            }
+            batch.clear();
+        }
+    }
+};
+
+// Opens path and attaches a sink that writes the records unformatted, after an
+// optional header. Returns false if the file cannot be created.
+template <typename Record>
+bool openBinaryOutput(OutputPipeline<Record>& pipeline, const std::string& path, const void* header = nullptr,
+                      std::size_t headerSize = 0) {
+    std::FILE* raw = std::fopen(path.c_str(), "wb");
+    if (!raw) {
+        return false;
+    }
+    std::shared_ptr<std::FILE> file(raw, std::fclose);
+    if (headerSize > 0) {
+        std::fwrite(header, 1, headerSize, file.get());
+    }
+    pipeline.open([file](const Record* records, std::size_t count) {
+        std::fwrite(records, sizeof(Record), count, file.get());
+    });
+    return true;
+}
+
+// Latest state of a model published by the simulation thread and read by a
+// GUI thread. Both sides only hold the lock while swapping or copying.
+template <typename Snapshot>
+class SnapshotBuffer {
+public:
+    SnapshotBuffer() : version(0) {}
+
+    // Publishes snapshot; the argument receives the previous one, so its
+    // storage can be reused for the next publish
+    void publish(Snapshot& snapshot) {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::swap(latest, snapshot);
+        ++version;
+    }
+
+    // Copies the latest snapshot into out; returns its version (0 = none yet)
+    std::size_t read(Snapshot& out) const {
+        std::lock_guard<std::mutex> lock(mtx);
+        out = latest;
+        return version;
+    }
+
+private:
+    mutable std::mutex mtx;
+    Snapshot latest;
+    std::size_t version;
+};
+
+} // namespace sim
+
+#endif
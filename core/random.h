@@ -0,0 +1,126 @@
+#ifndef SIM_RANDOM_H
+#define SIM_RANDOM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace sim {
+
+// splitmix64 finaliser
+inline std::uint64_t mix64(std::uint64_t z) {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Counter-based random numbers: the value only depends on (seed, stream,
+// counter), e.g. (seed, agent, step), so the result does not depend on which
+// thread processes an agent or in which order.
+inline std::uint64_t counterRandom(std::uint64_t seed, std::uint32_t stream, std::uint32_t counter) {
+    return mix64(seed ^ mix64((static_cast<std::uint64_t>(counter) << 32) | stream));
+}
+
+// Uniform integer in [0, n) from 32 random bits (multiply-shift instead of a modulo)
+inline std::uint32_t below(std::uint32_t bits, std::uint32_t n) {
+    return static_cast<std::uint32_t>((static_cast<std::uint64_t>(bits) * n) >> 32);
+}
+
+// xoshiro256** generator, seeded through splitmix64
+class Rng {
+public:
+    explicit Rng(std::uint64_t seed = 0) {
+        for (int i = 0; i < 4; ++i) {
+            seed += 0x9E3779B97F4A7C15ULL;
+            s[i] = mix64(seed);
+        }
+    }
+
+    std::uint64_t next() {
+        const std::uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const std::uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    // Uniform integer in [0, n)
+    std::uint32_t below(std::uint32_t n) {
+        return sim::below(static_cast<std::uint32_t>(next() >> 32), n);
+    }
+
+    // Uniform integer in [lo, hi]
+    int between(int lo, int hi) {
+        return lo + static_cast<int>(below(static_cast<std::uint32_t>(hi - lo + 1)));
+    }
+
+    // Uniform double in [0, 1)
+    double uniform() {
+        return static_cast<double>(next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    bool chance(double p) {
+        return uniform() < p;
+    }
+
+private:
+    std::uint64_t s[4];
+
+    static std::uint64_t rotl(std::uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+// One independent generator per worker thread of a ThreadPool. Each generator
+// sits at the start of its own 64-byte aligned slot, so neighbouring
+// generators never share a cache line. Which agents a worker handles depends
+// on scheduling, so use counterRandom() instead when results must not depend
+// on the number of threads.
+class RngPool {
+public:
+    static const std::size_t SlotSize = 64;
+
+    RngPool(std::uint64_t seed, std::size_t workers) : base(NULL), count(0) {
+        reseed(seed, workers);
+    }
+
+    void reseed(std::uint64_t seed, std::size_t workers) {
+        // One spare slot leaves room to round the start up to a slot boundary
+        storage.assign((workers + 1) * SlotSize, 0);
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage.data());
+        base = storage.data() + (SlotSize - address % SlotSize) % SlotSize;
+        count = workers;
+        for (std::size_t w = 0; w < workers; ++w) {
+            new (base + w * SlotSize) Rng(mix64(seed + w));
+        }
+    }
+
+    Rng& operator[](std::size_t worker) {
+        return *reinterpret_cast<Rng*>(base + worker * SlotSize);
+    }
+
+    std::size_t size() const {
+        return count;
+    }
+
+private:
+    static_assert(sizeof(Rng) <= SlotSize, "Rng must fit in one slot");
+
+    // Slots point into storage
+    RngPool(const RngPool&) = delete;
+    RngPool& operator=(const RngPool&) = delete;
+
+    std::vector<unsigned char> storage;
+    unsigned char* base;
+    std::size_t count;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef SIM_SCHEDULER_H
+#define SIM_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "timing.h"
+
+namespace sim {
+
+// Runs the phases of a model in the order they were added, once per step, and
+// keeps the wall-clock time of every phase
+class Scheduler {
+public:
+    // fn(step): step is the 0-based index of the step being run
+    typedef std::function<void(std::uint64_t)> PhaseFn;
+
+    struct Phase {
+        std::string name;
+        PhaseFn run;
+        TimingStats timing;
+    };
+
+    Scheduler() : stepCount(0) {}
+
+    void addPhase(const std::string& name, const PhaseFn& fn) {
+        Phase phase;
+        phase.name = name;
+        phase.run = fn;
+        phases.push_back(phase);
+    }
+
+    void step() {
+        for (auto& phase : phases) {
+            ScopedTimer timer(phase.timing);
+            phase.run(stepCount);
+        }
+        ++stepCount;
+    }
+
+    void run(std::uint64_t steps) {
+        for (std::uint64_t s = 0; s < steps; ++s) {
+            step();
+        }
+    }
+
+    std::uint64_t steps() const {
+        return stepCount;
+    }
+
+    // Restarts the step counter and the timings, keeping the phases
+    void reset() {
+        stepCount = 0;
+        for (auto& phase : phases) {
+            phase.timing = TimingStats();
+        }
+    }
+
+    const std::vector<Phase>& phaseList() const {
+        return phases;
+    }
+
+    void report(std::ostream& out) const {
+        const std::ios::fmtflags flags = out.flags();
+        const std::streamsize precision = out.precision();
+        double total = 0;
+        for (const auto& phase : phases) {
+            total += phase.timing.total;
+        }
+        for (const auto& phase : phases) {
+            out << std::left << std::setw(16) << phase.name << std::right << std::fixed << std::setprecision(3)
+                << std::setw(10) << phase.timing.total * 1e3 << " ms total" << std::setw(10)
+                << phase.timing.mean() * 1e3 << " ms/step" << std::setw(7) << std::setprecision(1)
+                << (total > 0 ? 100.0 * phase.timing.total / total : 0.0) << " %\n";
+        }
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    std::vector<Phase> phases;
+    std::uint64_t stepCount;
+};
+
+// Calls a function periodically on its own thread between start() and stop(),
+// for models that advance in real time while a GUI is shown
+class BackgroundLoop {
+public:
+    BackgroundLoop() : running(false) {}
+
+    ~BackgroundLoop() {
+        stop();
+    }
+
+    BackgroundLoop(const BackgroundLoop&) = delete;
+    BackgroundLoop& operator=(const BackgroundLoop&) = delete;
+
+    // Does nothing if the loop is already running
+    void start(const std::function<void()>& fn, std::chrono::milliseconds interval) {
+        if (running) {
+            return;
+        }
+        if (thread.joinable()) {
+            thread.join();
+        }
+        running = true;
+        thread = std::thread([this, fn, interval] {
+            while (running) {
+                fn();
+                std::this_thread::sleep_for(interval);
+            }
+        });
+    }
+
+    void stop() {
+        running = false;
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    bool isRunning() const {
+        return running;
+    }
+
+private:
+    std::atomic<bool> running;
+    std::thread thread;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIM_SIMULATION_H
+#define SIM_SIMULATION_H
+
+// Header-only agent-based simulation core shared by the models in this
+// repository. Tk integration lives separately in tk_loop.h so that models
+// without a GUI do not depend on Tcl/Tk.
+
+#include "agent_storage.h"
+#include "output.h"
+#include "random.h"
+#include "scheduler.h"
+#include "thread_pool.h"
+#include "timing.h"
+
+#endif
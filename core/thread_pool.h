@@ -0,0 +1,181 @@
+#ifndef SIM_THREAD_POOL_H
+#define SIM_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sim {
+
+inline unsigned defaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Work-stealing thread pool. Every worker owns a deque of index chunks; it
+// takes chunks from the back of its own deque and, once it runs dry, steals
+// from the front of the others. The calling thread takes part as worker 0, so
+// a pool of one thread runs everything inline.
+class ThreadPool {
+public:
+    // fn(begin, end, worker): worker is in [0, size()) and can index per-thread
+    // state such as an RngPool
+    typedef std::function<void(std::size_t, std::size_t, unsigned)> Task;
+
+    explicit ThreadPool(unsigned threadCount = defaultThreadCount())
+        : task(nullptr), remaining(0), generation(0), busy(0), stopping(false) {
+        threadCount = std::max(1u, threadCount);
+        for (unsigned w = 0; w < threadCount; ++w) {
+            queues.emplace_back(new Queue());
+        }
+        for (unsigned w = 1; w < threadCount; ++w) {
+            threads.emplace_back(&ThreadPool::workerLoop, this, w);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const {
+        return static_cast<unsigned>(queues.size());
+    }
+
+    // Calls fn on chunks of at most grain indices covering [0, count) and
+    // returns once all of them have run
+    void parallelFor(std::size_t count, std::size_t grain, const Task& fn) {
+        if (count == 0) {
+            return;
+        }
+        grain = std::max<std::size_t>(1, grain);
+        const std::size_t chunks = (count + grain - 1) / grain;
+        if (threads.empty() || chunks == 1) {
+            for (std::size_t begin = 0; begin < count; begin += grain) {
+                fn(begin, std::min(count, begin + grain), 0);
+            }
+            return;
+        }
+
+        // The task is published before any chunk becomes visible, so a worker
+        // that takes a chunk always sees the matching task.
+        task = &fn;
+        remaining = chunks;
+
+        // Contiguous runs of chunks per worker, so without stealing each thread
+        // keeps touching the same part of the data in every phase
+        const std::size_t workers = queues.size();
+        for (std::size_t w = 0; w < workers; ++w) {
+            Queue& queue = *queues[w];
+            std::lock_guard<std::mutex> lock(queue.mtx);
+            for (std::size_t c = (w + 1) * chunks / workers; c-- > w * chunks / workers;) {
+                queue.chunks.push_back(Chunk(c * grain, std::min(count, (c + 1) * grain)));
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            ++generation;
+        }
+        wake.notify_all();
+
+        runChunks(0);
+
+        std::unique_lock<std::mutex> lock(mtx);
+        done.wait(lock, [this] { return remaining == 0 && busy == 0; });
+        task = nullptr;
+    }
+
+private:
+    typedef std::pair<std::size_t, std::size_t> Chunk;
+
+    struct Queue {
+        std::mutex mtx;
+        std::deque<Chunk> chunks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex mtx;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const Task* task;
+    std::atomic<std::size_t> remaining;
+    std::size_t generation;
+    unsigned busy;
+    bool stopping;
+
+    bool takeChunk(unsigned worker, Chunk& chunk) {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mtx);
+            if (!own.chunks.empty()) {
+                chunk = own.chunks.back();
+                own.chunks.pop_back();
+                return true;
+            }
+        }
+        for (std::size_t k = 1; k < queues.size(); ++k) {
+            Queue& victim = *queues[(worker + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mtx);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.front();
+                victim.chunks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runChunks(unsigned worker) {
+        Chunk chunk;
+        while (takeChunk(worker, chunk)) {
+            (*task)(chunk.first, chunk.second, worker);
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(mtx);
+                done.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(unsigned worker) {
+        std::size_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                ++busy;
+            }
+            runChunks(worker);
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                --busy;
+            }
+            done.notify_all();
+        }
+    }
+};
+
+} // namespace sim
+
+#endif
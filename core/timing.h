@@ -0,0 +1,65 @@
+#ifndef SIM_TIMING_H
+#define SIM_TIMING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace sim {
+
+class Stopwatch {
+public:
+    Stopwatch() : start(std::chrono::steady_clock::now()) {}
+
+    void restart() {
+        start = std::chrono::steady_clock::now();
+    }
+
+    // Seconds since construction or the last restart()
+    double elapsed() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// Accumulated wall-clock time of something that runs repeatedly
+struct TimingStats {
+    std::uint64_t calls;
+    double total, min, max;
+
+    TimingStats() : calls(0), total(0), min(0), max(0) {}
+
+    void add(double seconds) {
+        min = calls == 0 ? seconds : std::min(min, seconds);
+        max = calls == 0 ? seconds : std::max(max, seconds);
+        total += seconds;
+        ++calls;
+    }
+
+    double mean() const {
+        return calls == 0 ? 0.0 : total / calls;
+    }
+};
+
+// Adds the lifetime of the scope to a TimingStats
+class ScopedTimer {
+public:
+    explicit ScopedTimer(TimingStats& stats) : stats(stats) {}
+
+    ~ScopedTimer() {
+        stats.add(watch.elapsed());
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    TimingStats& stats;
+    Stopwatch watch;
+};
+
+} // namespace sim
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef SIM_TK_LOOP_H
+#define SIM_TK_LOOP_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <tcl.h>
+#include <tk.h>
+
+namespace sim {
+
+// Drives a model from a Tk window: a periodic timer on the Tk event loop and
+// Tcl commands that start and stop the simulation (bound to buttons). Replaces
+// the global running flag each GUI model used to keep.
+class TkLoop {
+public:
+    TkLoop(Tcl_Interp* interp, int intervalMs, bool initiallyRunning = false)
+        : interp(interp), intervalMs(intervalMs), running(initiallyRunning) {}
+
+    TkLoop(const TkLoop&) = delete;
+    TkLoop& operator=(const TkLoop&) = delete;
+
+    // Called from the start/stop commands, after the running flag changed
+    void setOnStart(const std::function<void()>& fn) {
+        onStart = fn;
+    }
+
+    void setOnStop(const std::function<void()>& fn) {
+        onStop = fn;
+    }
+
+    // Registers the Tcl commands startName and stopName; their result is the given message
+    void addControlCommands(const std::string& startName, const std::string& stopName,
+                            const std::string& startMessage, const std::string& stopMessage) {
+        addCommand(startName, true, startMessage);
+        addCommand(stopName, false, stopMessage);
+    }
+
+    // Calls tick every intervalMs milliseconds from the Tk event loop, whether
+    // or not the simulation is running (the GUI keeps redrawing)
+    void schedule(const std::function<void()>& fn) {
+        tick = fn;
+        Tcl_CreateTimerHandler(intervalMs, onTimer, this);
+    }
+
+    bool isRunning() const {
+        return running;
+    }
+
+    Tcl_Interp* interpreter() const {
+        return interp;
+    }
+
+    void mainLoop() {
+        Tk_MainLoop();
+    }
+
+private:
+    struct Command {
+        TkLoop* loop;
+        bool start;
+        std::string message;
+    };
+
+    Tcl_Interp* interp;
+    int intervalMs;
+    std::atomic<bool> running;
+    std::function<void()> tick;
+    std::function<void()> onStart;
+    std::function<void()> onStop;
+    std::vector<std::unique_ptr<Command>> commands;
+
+    void addCommand(const std::string& name, bool start, const std::string& message) {
+        commands.emplace_back(new Command{this, start, message});
+        Tcl_CreateCommand(interp, name.c_str(), onCommand, commands.back().get(), NULL);
+    }
+
+    static void onTimer(ClientData clientData) {
+        TkLoop* loop = static_cast<TkLoop*>(clientData);
+        loop->tick();
+        Tcl_CreateTimerHandler(loop->intervalMs, onTimer, clientData);
+    }
+
+    static int onCommand(ClientData clientData, Tcl_Interp* interp, int, const char*[]) {
+        Command* command = static_cast<Command*>(clientData);
+        TkLoop* loop = command->loop;
+        loop->running = command->start;
+        const std::function<void()>& callback = command->start ? loop->onStart : loop->onStop;
+        if (callback) {
+            callback();
+        }
+        Tcl_SetResult(interp, const_cast<char*>(command->message.c_str()), TCL_VOLATILE);
+        return TCL_OK;
+    }
+};
+
+} // namespace sim
+
+#endif
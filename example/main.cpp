@@ -1,110 +1,866 @@
 #include <iostream>
 #include <string>
 #include <vector>
-#include <cstdlib> // For random numbers
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>   // For seeding random
+#include <functional>
+#include <utility>
 
-enum class State {
+#include "../core/simulation.h"
+
+enum class State : std::uint8_t {
     Idle,
     Moving,
     Searching
 };
 
-class Agent {
+const int NumStates = 3;
+
+std::string stateToString(State state) {
+    switch (state) {
+        case State::Idle: return "Idle";
+        case State::Moving: return "Moving";
+        case State::Searching: return "Searching";
+        default: return "Unknown";
+    }
+}
+
+// Random steps use sim::counterRandom(seed, agent, step), so the order in which
+// agents are processed does not change the result.
+
+// Initial cell of the index-th randomly placed agent
+inline void randomCell(std::uint64_t seed, std::size_t index, int width, int height, int& x, int& y) {
+    const std::uint64_t r = sim::mix64(seed ^ (0xA5A5A5A5ULL + index));
+    x = static_cast<int>((r & 0xFFFFFFFFULL) % width);
+    y = static_cast<int>((r >> 32) % height);
+}
+
+// Order-independent fingerprint of one agent, summed to compare engines and runs
+inline std::uint64_t agentFingerprint(std::uint32_t agent, std::int32_t x, std::int32_t y, State state) {
+    const std::uint64_t cell = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(x)) << 32) | static_cast<std::uint32_t>(y);
+    return sim::mix64(((static_cast<std::uint64_t>(agent) << 2) | static_cast<std::uint64_t>(state)) ^ sim::mix64(cell));
+}
+
+// -1, 0 or 1 from 32 random bits
+inline int randomOffset(std::uint32_t bits) {
+    return static_cast<int>(sim::below(bits, 3)) - 1;
+}
+
+// ---------------------------------------------------------------------------
+// Binary event log
+// ---------------------------------------------------------------------------
+
+enum class EventKind : std::uint8_t {
+    Moved,
+    StateChanged,
+    Searched
+};
+
+// Fixed-size record written as-is to the log file
+struct Event {
+    std::uint32_t step;
+    std::uint32_t agent;
+    std::int32_t x, y;
+    EventKind kind;
+    State state;
+    std::uint16_t reserved;
+};
+
+static_assert(sizeof(Event) == 20, "Event must stay a packed 20-byte record");
+
+inline Event makeEvent(std::uint32_t step, std::uint32_t agent, std::int32_t x, std::int32_t y, EventKind kind, State state) {
+    Event e;
+    e.step = step;
+    e.agent = agent;
+    e.x = x;
+    e.y = y;
+    e.kind = kind;
+    e.state = state;
+    e.reserved = 0;
+    return e;
+}
+
+const char EventLogMagic[8] = {'A', 'G', 'E', 'N', 'T', 'E', 'V', '1'};
+
+// Events are buffered and written to disk by a background thread
+typedef sim::OutputPipeline<Event> EventLog;
+
+bool openEventLog(EventLog& log, const std::string& path) {
+    return sim::openBinaryOutput(log, path, EventLogMagic, sizeof(EventLogMagic));
+}
+
+// Prints events as text, one line per event prefixed with its step and agent
+void printEvents(const Event* events, std::size_t count, std::ostream& out) {
+    for (std::size_t i = 0; i < count; ++i) {
+        const Event& e = events[i];
+        out << "[step " << e.step + 1 << "] Agent " << e.agent << ": ";
+        switch (e.kind) {
+            case EventKind::Moved:
+                out << "moved to (" << e.x << ", " << e.y << ")\n";
+                break;
+            case EventKind::StateChanged:
+                out << "state changed to: " << stateToString(e.state) << "\n";
+                break;
+            case EventKind::Searched:
+                out << "is searching at (" << e.x << ", " << e.y << ")\n";
+                break;
+        }
+    }
+}
+
+// Attaches a sink that prints the events as text instead of writing a file
+void openConsoleEventLog(EventLog& log, std::ostream& out) {
+    log.open([&out](const Event* events, std::size_t count) { printEvents(events, count, out); });
+}
+
+// Prints a binary event log as text (see printEvents)
+bool printEventLog(const std::string& path, std::ostream& out) {
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (!in) {
+        return false;
+    }
+    char magic[sizeof(EventLogMagic)];
+    if (std::fread(magic, 1, sizeof(magic), in) != sizeof(magic) ||
+        std::memcmp(magic, EventLogMagic, sizeof(magic)) != 0) {
+        std::fclose(in);
+        return false;
+    }
+
+    std::vector<Event> chunk(1 << 14);
+    std::size_t count;
+    while ((count = std::fread(chunk.data(), sizeof(Event), chunk.size(), in)) > 0) {
+        printEvents(chunk.data(), count, out);
+    }
+    std::fclose(in);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Batch environment
+// ---------------------------------------------------------------------------
+
+// Agents are stored as separate arrays (positions and state) and, in addition,
+// as one index list per state. Every state has its own kernel that only walks
+// its own list, so the inner loops never test the state of an agent.
+//
+// Per step every agent goes through the same transitions the old Agent class
+// implemented: Idle -> Moving, Moving moves (and switches to Searching when it
+// reaches the target cell), Searching searches and goes back to Idle. The three
+// kernels are the phases of the step scheduler.
+class Environment {
 private:
-    int x, y; // Position in 2D space
-    State currentState;
+    enum { AgentX, AgentY, AgentState };
 
-public:
-    Agent(int startX, int startY) : x(startX), y(startY), currentState(State::Idle) {}
+    int width, height;
+    int targetX, targetY;
+    std::uint64_t seed;
 
-    void move(int width, int height) {
-        if (currentState == State::Moving) {
-            // Move to a random adjacent cell
-            x += (rand() % 3) - 1; // -1, 0, or 1
-            y += (rand() % 3) - 1;
+    sim::AgentStorage<std::int32_t, std::int32_t, State> agents;
+    std::vector<std::uint32_t> byState[NumStates];
+    std::vector<std::uint32_t> hits; // scratch for moveKernel, grows with the population only
 
-            // Keep position within bounds
-            x = std::max(0, std::min(width - 1, x));
-            y = std::max(0, std::min(height - 1, y));
+    sim::Scheduler scheduler;
+    EventLog* log;
 
-            std::cout << "Agent moved to (" << x << ", " << y << ")\n";
+    std::vector<std::uint32_t>& agentsIn(State state) {
+        return byState[static_cast<int>(state)];
+    }
 
-            // Example rule: if reaches (5,5), switch to Searching
-            if (x == 5 && y == 5) {
-                changeState(State::Searching);
+    // Idle -> Moving
+    template <bool Logging>
+    void startMovingKernel(std::uint32_t step) {
+        std::vector<std::int32_t>& xs = agents.column<AgentX>();
+        std::vector<std::int32_t>& ys = agents.column<AgentY>();
+        std::vector<State>& states = agents.column<AgentState>();
+        std::vector<std::uint32_t>& idle = agentsIn(State::Idle);
+        std::vector<std::uint32_t>& moving = agentsIn(State::Moving);
+        for (std::uint32_t i : idle) {
+            states[i] = State::Moving;
+            if (Logging) {
+                log->push(makeEvent(step, i, xs[i], ys[i], EventKind::StateChanged, State::Moving));
             }
         }
+        moving.insert(moving.end(), idle.begin(), idle.end());
+        idle.clear();
     }
 
-    void changeState(State newState) {
-        currentState = newState;
-        std::cout << "State changed to: " << stateToString(currentState) << "\n";
+    // Random step for every moving agent. Agents that land on the target are
+    // compacted out of the moving list into the searching list without a
+    // branch: each index is written to both the moving list and the hits
+    // scratch buffer, and only one cursor advances.
+    template <bool Logging>
+    void moveKernel(std::uint32_t step) {
+        std::vector<std::int32_t>& xs = agents.column<AgentX>();
+        std::vector<std::int32_t>& ys = agents.column<AgentY>();
+        std::vector<State>& states = agents.column<AgentState>();
+        std::vector<std::uint32_t>& moving = agentsIn(State::Moving);
+        std::vector<std::uint32_t>& searching = agentsIn(State::Searching);
+
+        const std::size_t count = moving.size();
+        if (hits.size() < count) {
+            hits.resize(agents.size());
+        }
+
+        std::uint32_t* movingOut = moving.data();
+        std::uint32_t* searchingOut = hits.data();
+        std::size_t kept = 0;
+        std::size_t found = 0;
+        const std::int32_t maxX = width - 1;
+        const std::int32_t maxY = height - 1;
+
+        for (std::size_t k = 0; k < count; ++k) {
+            const std::uint32_t i = moving[k];
+            const std::uint64_t r = sim::counterRandom(seed, i, step);
+            std::int32_t x = xs[i] + randomOffset(static_cast<std::uint32_t>(r));
+            std::int32_t y = ys[i] + randomOffset(static_cast<std::uint32_t>(r >> 32));
+            x = std::max<std::int32_t>(0, std::min(maxX, x));
+            y = std::max<std::int32_t>(0, std::min(maxY, y));
+            xs[i] = x;
+            ys[i] = y;
+
+            const std::size_t hit = (x == targetX) & (y == targetY);
+            movingOut[kept] = i;
+            searchingOut[found] = i;
+            kept += 1 - hit;
+            found += hit;
+
+            if (Logging) {
+                log->push(makeEvent(step, i, x, y, EventKind::Moved, State::Moving));
+            }
+        }
+
+        moving.resize(kept);
+        const std::size_t searchingBase = searching.size();
+        searching.insert(searching.end(), hits.begin(), hits.begin() + found);
+        for (std::size_t k = searchingBase; k < searching.size(); ++k) {
+            const std::uint32_t i = searching[k];
+            states[i] = State::Searching;
+            if (Logging) {
+                log->push(makeEvent(step, i, xs[i], ys[i], EventKind::StateChanged, State::Searching));
+            }
+        }
     }
 
-    void act() {
-        if (currentState == State::Searching) {
-            std::cout << "Agent is searching at (" << x << ", " << y << ")\n";
-            // After "searching," go back to Idle
-            changeState(State::Idle);
+    // Searching -> Idle
+    template <bool Logging>
+    void actKernel(std::uint32_t step) {
+        std::vector<std::int32_t>& xs = agents.column<AgentX>();
+        std::vector<std::int32_t>& ys = agents.column<AgentY>();
+        std::vector<State>& states = agents.column<AgentState>();
+        std::vector<std::uint32_t>& searching = agentsIn(State::Searching);
+        std::vector<std::uint32_t>& idle = agentsIn(State::Idle);
+        for (std::uint32_t i : searching) {
+            states[i] = State::Idle;
+            if (Logging) {
+                log->push(makeEvent(step, i, xs[i], ys[i], EventKind::Searched, State::Searching));
+                log->push(makeEvent(step, i, xs[i], ys[i], EventKind::StateChanged, State::Idle));
+            }
         }
+        idle.insert(idle.end(), searching.begin(), searching.end());
+        searching.clear();
     }
 
-    std::string stateToString(State state) {
-        switch (state) {
-            case State::Idle: return "Idle";
-            case State::Moving: return "Moving";
-            case State::Searching: return "Searching";
-            default: return "Unknown";
+public:
+    Environment(int w, int h, std::uint64_t seed)
+        : width(w), height(h), targetX(5), targetY(5), seed(seed), log(nullptr) {
+        scheduler.addPhase("startMoving", [this](std::uint64_t step) {
+            if (log) {
+                startMovingKernel<true>(static_cast<std::uint32_t>(step));
+            } else {
+                startMovingKernel<false>(static_cast<std::uint32_t>(step));
+            }
+        });
+        scheduler.addPhase("move", [this](std::uint64_t step) {
+            if (log) {
+                moveKernel<true>(static_cast<std::uint32_t>(step));
+            } else {
+                moveKernel<false>(static_cast<std::uint32_t>(step));
+            }
+        });
+        scheduler.addPhase("act", [this](std::uint64_t step) {
+            if (log) {
+                actKernel<true>(static_cast<std::uint32_t>(step));
+            } else {
+                actKernel<false>(static_cast<std::uint32_t>(step));
+            }
+        });
+    }
+
+    void reserve(std::size_t count) {
+        agents.reserve(count);
+        for (auto& list : byState) {
+            list.reserve(count);
         }
     }
 
-    void startMoving() {
-        if (currentState == State::Idle) {
-            changeState(State::Moving);
+    void addAgent(int x, int y) {
+        const std::uint32_t id = static_cast<std::uint32_t>(agents.push_back(x, y, State::Idle));
+        agentsIn(State::Idle).push_back(id);
+    }
+
+    // Places count agents uniformly at random on the grid
+    void addRandomAgents(std::size_t count) {
+        reserve(agents.size() + count);
+        for (std::size_t k = 0; k < count; ++k) {
+            int x, y;
+            randomCell(seed, agents.size(), width, height, x, y);
+            addAgent(x, y);
         }
     }
+
+    // Events are recorded only while a log is attached; pass nullptr to detach
+    void setEventLog(EventLog* eventLog) {
+        log = (eventLog && eventLog->isOpen()) ? eventLog : nullptr;
+    }
+
+    void update() {
+        scheduler.step();
+    }
+
+    std::size_t size() const {
+        return agents.size();
+    }
+
+    std::size_t count(State state) const {
+        return byState[static_cast<int>(state)].size();
+    }
+
+    std::uint32_t steps() const {
+        return static_cast<std::uint32_t>(scheduler.steps());
+    }
+
+    const sim::Scheduler& timings() const {
+        return scheduler;
+    }
+
+    std::uint64_t checksum() const {
+        const std::vector<std::int32_t>& xs = agents.column<AgentX>();
+        const std::vector<std::int32_t>& ys = agents.column<AgentY>();
+        const std::vector<State>& states = agents.column<AgentState>();
+        std::uint64_t sum = 0;
+        for (std::size_t i = 0; i < agents.size(); ++i) {
+            sum += agentFingerprint(static_cast<std::uint32_t>(i), xs[i], ys[i], states[i]);
+        }
+        return sum;
+    }
 };
 
-class Environment {
+// ---------------------------------------------------------------------------
+// Tiled grid environment
+// ---------------------------------------------------------------------------
+
+// Same agent rules as Environment, but the grid is split into square tiles that
+// own the agents standing on them. Inside a tile the agents are kept sorted by
+// local cell, next to an array of their cell keys, so the agents of one cell
+// are a contiguous range found by binary search over the tile's agents (a
+// handful of comparisons at realistic densities). Nothing is stored per cell,
+// so memory and time per step follow the number of agents, not the grid size.
+//
+// A step has three phases, each one a parallel loop over tiles on the
+// work-stealing sim::ThreadPool:
+//   1. move:   agents take their random step; agents that stay are written to
+//              the tile's own outbox, agents that cross a border to the outbox
+//              facing the neighbouring tile (moves are at most one cell, so
+//              only the eight neighbours can receive agents).
+//   2. gather: every tile reads the outboxes of itself and its neighbours that
+//              face it (its inbox), always in the same order, and sorts the
+//              agents by cell.
+//   3. act:    agents on the target cell search their neighbourhood and go
+//              back to Idle.
+// Each outbox has exactly one writer and one reader and the merge order is
+// fixed, so the result is identical for any number of threads.
+class TiledEnvironment {
 private:
+    enum { AgentId, AgentX, AgentY, AgentState };
+
+    typedef sim::AgentStorage<std::uint32_t, std::int32_t, std::int32_t, State> TileAgents;
+
+    struct AgentRecord {
+        std::uint32_t id;
+        std::int32_t x, y;
+        State state;
+    };
+
+    struct Tile {
+        int x0, y0, w, h;
+
+        TileAgents agents;                    // sorted by local cell
+        std::vector<std::uint32_t> cellKeys;  // local cell of each agent, ascending
+        std::vector<AgentRecord> incoming;    // gather scratch: the inbox in fixed order
+        std::vector<std::uint64_t> order;     // gather scratch: (cell, arrival) sort keys
+        std::vector<AgentRecord> pending;     // added since the last step, moved by the next one
+
+        std::vector<std::uint32_t> searching; // local indices of agents on the target
+        std::vector<AgentRecord> outbox[9];   // indexed by direction, [4] stays here
+        std::vector<Event> events;            // filled only while logging
+        std::uint64_t encounters;
+    };
+
     int width, height;
-    std::vector<Agent> agents;
+    int tileSize;
+    int tilesX, tilesY;
+    int targetX, targetY;
+    std::uint64_t seed;
+    std::size_t agentCount;
+
+    std::vector<Tile> tiles;
+    sim::ThreadPool pool;
+    std::vector<std::vector<std::uint32_t>> cellCounts; // per worker, one tile of cells + 1
+    sim::Scheduler scheduler;
+    EventLog* log;
+
+    static const std::size_t TileGrain = 4;
+
+    std::size_t tileIndex(int x, int y) const {
+        return static_cast<std::size_t>(y / tileSize) * tilesX + x / tileSize;
+    }
+
+    template <bool Logging>
+    void moveAgent(Tile& tile, std::uint32_t id, std::int32_t x, std::int32_t y, State state, std::uint32_t step) {
+        if (Logging && state == State::Idle) {
+            tile.events.push_back(makeEvent(step, id, x, y, EventKind::StateChanged, State::Moving));
+        }
+
+        // Idle agents start moving and every agent is moving at this point
+        const std::uint64_t r = sim::counterRandom(seed, id, step);
+        x = std::max<std::int32_t>(0, std::min<std::int32_t>(width - 1, x + randomOffset(static_cast<std::uint32_t>(r))));
+        y = std::max<std::int32_t>(0, std::min<std::int32_t>(height - 1, y + randomOffset(static_cast<std::uint32_t>(r >> 32))));
+
+        const bool hit = (x == targetX) & (y == targetY);
+        const int dx = (x >= tile.x0 + tile.w) - (x < tile.x0);
+        const int dy = (y >= tile.y0 + tile.h) - (y < tile.y0);
+
+        AgentRecord record;
+        record.id = id;
+        record.x = x;
+        record.y = y;
+        record.state = hit ? State::Searching : State::Moving;
+        tile.outbox[(dy + 1) * 3 + dx + 1].push_back(record);
+
+        if (Logging) {
+            tile.events.push_back(makeEvent(step, id, x, y, EventKind::Moved, State::Moving));
+            if (hit) {
+                tile.events.push_back(makeEvent(step, id, x, y, EventKind::StateChanged, State::Searching));
+            }
+        }
+    }
+
+    // Resident agents first, then the ones added since the last step
+    template <bool Logging>
+    void moveTile(Tile& tile, std::uint32_t step) {
+        const std::vector<std::uint32_t>& ids = tile.agents.column<AgentId>();
+        const std::vector<std::int32_t>& xs = tile.agents.column<AgentX>();
+        const std::vector<std::int32_t>& ys = tile.agents.column<AgentY>();
+        const std::vector<State>& states = tile.agents.column<AgentState>();
+        const std::size_t count = tile.agents.size();
+        for (std::size_t k = 0; k < count; ++k) {
+            moveAgent<Logging>(tile, ids[k], xs[k], ys[k], states[k], step);
+        }
+        for (const AgentRecord& record : tile.pending) {
+            moveAgent<Logging>(tile, record.id, record.x, record.y, record.state, step);
+        }
+        tile.pending.clear();
+    }
+
+    std::size_t localCell(const Tile& tile, int x, int y) const {
+        return static_cast<std::size_t>(y - tile.y0) * tile.w + (x - tile.x0);
+    }
+
+    void gatherTile(std::size_t index, unsigned worker) {
+        Tile& tile = tiles[index];
+        const int tx = static_cast<int>(index % tilesX);
+        const int ty = static_cast<int>(index / tilesX);
+
+        // Read the inbox in fixed order
+        tile.incoming.clear();
+        for (int d = 0; d < 9; ++d) {
+            const int nx = tx + d % 3 - 1;
+            const int ny = ty + d / 3 - 1;
+            if (nx < 0 || ny < 0 || nx >= tilesX || ny >= tilesY) {
+                continue;
+            }
+            // The neighbour at offset d sends towards us through the opposite direction
+            std::vector<AgentRecord>& inbox = tiles[static_cast<std::size_t>(ny) * tilesX + nx].outbox[8 - d];
+            tile.incoming.insert(tile.incoming.end(), inbox.begin(), inbox.end());
+            inbox.clear();
+        }
+
+        tile.searching.clear();
+        const std::size_t count = tile.incoming.size();
+        if (count == 0 && tile.agents.empty()) {
+            return;
+        }
+
+        // Order by cell, ties in arrival order. Sparse tiles sort (cell, arrival)
+        // keys; dense tiles counting-sort through the worker's cell histogram,
+        // which gives the same order. Both avoid any state kept per cell.
+        const std::size_t cells = static_cast<std::size_t>(tile.w) * tile.h;
+        tile.order.resize(count);
+        if (count * 8 < cells) {
+            for (std::size_t k = 0; k < count; ++k) {
+                const AgentRecord& record = tile.incoming[k];
+                tile.order[k] = (static_cast<std::uint64_t>(localCell(tile, record.x, record.y)) << 32) | k;
+            }
+            std::sort(tile.order.begin(), tile.order.end());
+        } else {
+            std::vector<std::uint32_t>& start = cellCounts[worker];
+            std::fill(start.begin(), start.begin() + cells + 1, 0);
+            for (const AgentRecord& record : tile.incoming) {
+                ++start[localCell(tile, record.x, record.y) + 1];
+            }
+            for (std::size_t c = 0; c < cells; ++c) {
+                start[c + 1] += start[c];
+            }
+            for (std::size_t k = 0; k < count; ++k) {
+                const AgentRecord& record = tile.incoming[k];
+                const std::size_t cell = localCell(tile, record.x, record.y);
+                tile.order[start[cell]++] = (static_cast<std::uint64_t>(cell) << 32) | k;
+            }
+        }
+
+        tile.agents.resize(count);
+        tile.cellKeys.resize(count);
+        std::vector<std::uint32_t>& ids = tile.agents.column<AgentId>();
+        std::vector<std::int32_t>& xs = tile.agents.column<AgentX>();
+        std::vector<std::int32_t>& ys = tile.agents.column<AgentY>();
+        std::vector<State>& states = tile.agents.column<AgentState>();
+        for (std::size_t k = 0; k < count; ++k) {
+            const AgentRecord& record = tile.incoming[tile.order[k] & 0xFFFFFFFFu];
+            ids[k] = record.id;
+            xs[k] = record.x;
+            ys[k] = record.y;
+            states[k] = record.state;
+            tile.cellKeys[k] = static_cast<std::uint32_t>(tile.order[k] >> 32);
+        }
+
+        if (targetX >= tile.x0 && targetX < tile.x0 + tile.w && targetY >= tile.y0 && targetY < tile.y0 + tile.h) {
+            const std::pair<std::size_t, std::size_t> range = cellRange(tile, targetX, targetY);
+            for (std::size_t k = range.first; k < range.second; ++k) {
+                if (states[k] == State::Searching) {
+                    tile.searching.push_back(static_cast<std::uint32_t>(k));
+                }
+            }
+        }
+    }
+
+    // Local indices [first, second) of the agents on cell (x, y) of tile
+    std::pair<std::size_t, std::size_t> cellRange(const Tile& tile, int x, int y) const {
+        const std::uint32_t key = static_cast<std::uint32_t>(localCell(tile, x, y));
+        auto range = std::equal_range(tile.cellKeys.begin(), tile.cellKeys.end(), key);
+        return std::make_pair(static_cast<std::size_t>(range.first - tile.cellKeys.begin()),
+                              static_cast<std::size_t>(range.second - tile.cellKeys.begin()));
+    }
+
+    template <bool Logging>
+    void actTile(Tile& tile, std::uint32_t step) {
+        const std::vector<std::uint32_t>& ids = tile.agents.column<AgentId>();
+        const std::vector<std::int32_t>& xs = tile.agents.column<AgentX>();
+        const std::vector<std::int32_t>& ys = tile.agents.column<AgentY>();
+        std::vector<State>& states = tile.agents.column<AgentState>();
+        for (std::uint32_t k : tile.searching) {
+            // Everybody else in the 3x3 neighbourhood is an encounter
+            tile.encounters += countNeighbourhood(xs[k], ys[k]) - 1;
+            states[k] = State::Idle;
+            if (Logging) {
+                tile.events.push_back(makeEvent(step, ids[k], xs[k], ys[k], EventKind::Searched, State::Searching));
+                tile.events.push_back(makeEvent(step, ids[k], xs[k], ys[k], EventKind::StateChanged, State::Idle));
+            }
+        }
+    }
+
+    // fn(tile, worker)
+    template <typename Fn>
+    void forEachTile(const Fn& fn) {
+        pool.parallelFor(tiles.size(), TileGrain, [&](std::size_t begin, std::size_t end, unsigned worker) {
+            for (std::size_t t = begin; t < end; ++t) {
+                fn(t, worker);
+            }
+        });
+    }
+
+    void gatherAll() {
+        forEachTile([this](std::size_t t, unsigned worker) { gatherTile(t, worker); });
+    }
+
+    template <bool Logging>
+    void moveAll(std::uint32_t step) {
+        forEachTile([this, step](std::size_t t, unsigned) { moveTile<Logging>(tiles[t], step); });
+    }
+
+    template <bool Logging>
+    void actAll(std::uint32_t step) {
+        forEachTile([this, step](std::size_t t, unsigned) { actTile<Logging>(tiles[t], step); });
+    }
+
+    // Drained in tile order, so the log is deterministic as well
+    void drainEvents() {
+        for (Tile& tile : tiles) {
+            for (const Event& e : tile.events) {
+                log->push(e);
+            }
+            tile.events.clear();
+        }
+    }
 
 public:
-    Environment(int w, int h) : width(w), height(h) {}
+    TiledEnvironment(int w, int h, std::uint64_t seed, unsigned threads, int tileSize = 64)
+        : width(w), height(h), tileSize(std::max(1, tileSize)), targetX(5), targetY(5), seed(seed),
+          agentCount(0), pool(threads), log(nullptr) {
+        tilesX = (width + this->tileSize - 1) / this->tileSize;
+        tilesY = (height + this->tileSize - 1) / this->tileSize;
+        tiles.resize(static_cast<std::size_t>(tilesX) * tilesY);
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                Tile& tile = tiles[static_cast<std::size_t>(ty) * tilesX + tx];
+                tile.x0 = tx * this->tileSize;
+                tile.y0 = ty * this->tileSize;
+                tile.w = std::min(this->tileSize, width - tile.x0);
+                tile.h = std::min(this->tileSize, height - tile.y0);
+                tile.encounters = 0;
+            }
+        }
+        cellCounts.assign(pool.size(), std::vector<std::uint32_t>(static_cast<std::size_t>(this->tileSize) * this->tileSize + 1));
+
+        scheduler.addPhase("move", [this](std::uint64_t step) {
+            if (log) {
+                moveAll<true>(static_cast<std::uint32_t>(step));
+            } else {
+                moveAll<false>(static_cast<std::uint32_t>(step));
+            }
+        });
+        scheduler.addPhase("gather", [this](std::uint64_t) { gatherAll(); });
+        scheduler.addPhase("act", [this](std::uint64_t step) {
+            if (log) {
+                actAll<true>(static_cast<std::uint32_t>(step));
+                drainEvents();
+            } else {
+                actAll<false>(static_cast<std::uint32_t>(step));
+            }
+        });
+    }
+
+    void addAgent(int x, int y) {
+        x = std::max(0, std::min(width - 1, x));
+        y = std::max(0, std::min(height - 1, y));
+        AgentRecord record;
+        record.id = static_cast<std::uint32_t>(agentCount++);
+        record.x = x;
+        record.y = y;
+        record.state = State::Idle;
+        tiles[tileIndex(x, y)].pending.push_back(record);
+    }
+
+    // Places count agents at the same cells Environment::addRandomAgents uses
+    void addRandomAgents(std::size_t count) {
+        for (std::size_t k = 0; k < count; ++k) {
+            int x, y;
+            randomCell(seed, agentCount, width, height, x, y);
+            addAgent(x, y);
+        }
+    }
 
-    void addAgent(Agent agent) {
-        agents.push_back(agent);
+    void setEventLog(EventLog* eventLog) {
+        log = (eventLog && eventLog->isOpen()) ? eventLog : nullptr;
     }
 
     void update() {
-        for (auto& agent : agents) {
-            agent.startMoving(); // Ensure agents can start moving if idle
-            agent.move(width, height);
-            agent.act();
+        scheduler.step();
+    }
+
+    // Agents added since the last update() are not visible to the cell and
+    // neighbourhood queries below until the next update(); size(), count() and
+    // checksum() include them.
+
+    // Ids of the agents on cell (x, y)
+    std::pair<const std::uint32_t*, const std::uint32_t*> agentsInCell(int x, int y) const {
+        const Tile& tile = tiles[tileIndex(x, y)];
+        const std::pair<std::size_t, std::size_t> range = cellRange(tile, x, y);
+        const std::uint32_t* base = tile.agents.column<AgentId>().data();
+        return std::make_pair(base + range.first, base + range.second);
+    }
+
+    // Calls fn(id) for every agent in the 3x3 cells around (x, y), including (x, y)
+    template <typename Fn>
+    void forEachInNeighbourhood(int x, int y, const Fn& fn) const {
+        for (int ny = std::max(0, y - 1); ny <= std::min(height - 1, y + 1); ++ny) {
+            for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1); ++nx) {
+                auto range = agentsInCell(nx, ny);
+                for (const std::uint32_t* it = range.first; it != range.second; ++it) {
+                    fn(*it);
+                }
+            }
         }
     }
-};
 
-int main() {
-    srand(static_cast<unsigned>(time(0))); // Seed for random numbers
+    std::size_t countNeighbourhood(int x, int y) const {
+        std::size_t count = 0;
+        for (int ny = std::max(0, y - 1); ny <= std::min(height - 1, y + 1); ++ny) {
+            for (int nx = std::max(0, x - 1); nx <= std::min(width - 1, x + 1); ++nx) {
+                auto range = agentsInCell(nx, ny);
+                count += range.second - range.first;
+            }
+        }
+        return count;
+    }
+
+    std::size_t size() const {
+        return agentCount;
+    }
+
+    std::size_t count(State state) const {
+        std::size_t total = 0;
+        for (const Tile& tile : tiles) {
+            const std::vector<State>& states = tile.agents.column<AgentState>();
+            total += std::count(states.begin(), states.end(), state);
+            for (const AgentRecord& record : tile.pending) {
+                total += record.state == state;
+            }
+        }
+        return total;
+    }
 
-    Environment env(10, 10); // Create a 10x10 grid
+    std::uint32_t steps() const {
+        return static_cast<std::uint32_t>(scheduler.steps());
+    }
 
-    // Create agents
-    Agent agent1(0, 0);
-    Agent agent2(9, 9);
+    const sim::Scheduler& timings() const {
+        return scheduler;
+    }
 
-    // Add agents to the environment
-    env.addAgent(agent1);
-    env.addAgent(agent2);
+    unsigned threads() const {
+        return pool.size();
+    }
 
-    // Simulate for a few steps
-    for (int step = 0; step < 10; ++step) {
-        std::cout << "Step " << step + 1 << ":\n";
+    // Total number of other agents met by searching agents so far
+    std::uint64_t encounters() const {
+        std::uint64_t total = 0;
+        for (const Tile& tile : tiles) {
+            total += tile.encounters;
+        }
+        return total;
+    }
+
+    std::uint64_t checksum() const {
+        std::uint64_t sum = 0;
+        for (const Tile& tile : tiles) {
+            const std::vector<std::uint32_t>& ids = tile.agents.column<AgentId>();
+            const std::vector<std::int32_t>& xs = tile.agents.column<AgentX>();
+            const std::vector<std::int32_t>& ys = tile.agents.column<AgentY>();
+            const std::vector<State>& states = tile.agents.column<AgentState>();
+            for (std::size_t k = 0; k < tile.agents.size(); ++k) {
+                sum += agentFingerprint(ids[k], xs[k], ys[k], states[k]);
+            }
+            for (const AgentRecord& record : tile.pending) {
+                sum += agentFingerprint(record.id, record.x, record.y, record.state);
+            }
+        }
+        return sum;
+    }
+};
+
+// Runs the simulation on either environment and prints a summary
+template <typename Env>
+double run(Env& env, int steps, EventLog& log) {
+    sim::Stopwatch watch;
+    for (int step = 0; step < steps; ++step) {
         env.update();
-        std::cout << "-------------------------\n";
+    }
+    log.close();
+    const double elapsed = watch.elapsed();
+
+    std::cout << env.size() << " agents x " << env.steps() << " steps in " << elapsed << " s ("
+              << (elapsed > 0 ? env.size() * static_cast<double>(env.steps()) / elapsed : 0.0) << " agent-steps/s)\n";
+    std::cout << "Idle: " << env.count(State::Idle) << ", Moving: " << env.count(State::Moving)
+              << ", Searching: " << env.count(State::Searching) << "\n";
+    std::cout << "Checksum: " << std::hex << env.checksum() << std::dec << "\n";
+    env.timings().report(std::cout);
+    return elapsed;
+}
+
+// Usage:
+//   example [options] [numAgents] [steps] [width] [height] [eventLog]
+//   example --dump eventLog
+// Options:
+//   --tiled         use the parallel tiled engine
+//   --threads N     worker threads for --tiled (default: all cores)
+//   --tile N        tile edge in cells for --tiled (default: 64)
+//   --seed S        fixed seed; both engines give the same checksum for it
+// Without positional arguments the original two-agent demo runs on a 10x10
+// grid and the events are printed to the console instead of a log file.
+int main(int argc, char* argv[]) {
+    if (argc == 3 && std::string(argv[1]) == "--dump") {
+        if (!printEventLog(argv[2], std::cout)) {
+            std::cerr << "Error: could not read event log " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    bool tiled = false;
+    unsigned threads = sim::defaultThreadCount();
+    int tileSize = 64;
+    std::uint64_t seed = static_cast<std::uint64_t>(time(0)); // Seed for random numbers
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--tiled") {
+            tiled = true;
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = static_cast<unsigned>(std::max(1, std::atoi(argv[++i])));
+        } else if (arg == "--tile" && i + 1 < argc) {
+            tileSize = std::atoi(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = std::strtoull(argv[++i], nullptr, 10);
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    const bool demo = args.empty();
+    const std::size_t numAgents = args.size() > 0 ? std::strtoull(args[0].c_str(), nullptr, 10) : 2;
+    const int steps = args.size() > 1 ? std::atoi(args[1].c_str()) : 10;
+    const int width = args.size() > 2 ? std::atoi(args[2].c_str()) : 10;
+    const int height = args.size() > 3 ? std::atoi(args[3].c_str()) : 10;
+    const std::string logPath = args.size() > 4 ? args[4] : "";
+
+    if (width <= 0 || height <= 0 || steps < 0 || tileSize <= 0) {
+        std::cerr << "Error: width, height, steps and tile size must be positive" << std::endl;
+        return 1;
+    }
+
+    EventLog log;
+    if (demo) {
+        openConsoleEventLog(log, std::cout);
+    } else if (!logPath.empty() && !openEventLog(log, logPath)) {
+        std::cerr << "Error: could not create event log " << logPath << std::endl;
+        return 1;
+    }
+
+    if (tiled) {
+        TiledEnvironment env(width, height, seed, threads, tileSize);
+        if (demo) {
+            env.addAgent(0, 0);
+            env.addAgent(9, 9);
+        } else {
+            env.addRandomAgents(numAgents);
+        }
+        env.setEventLog(&log);
+        run(env, steps, log);
+        std::cout << "Threads: " << env.threads() << ", encounters: " << env.encounters() << "\n";
+    } else {
+        Environment env(width, height, seed);
+        if (demo) {
+            env.addAgent(0, 0);
+            env.addAgent(9, 9);
+        } else {
+            env.addRandomAgents(numAgents);
+        }
+        env.setEventLog(&log);
+        run(env, steps, log);
     }
 
     return 0;
@@ -2,12 +2,13 @@
 #include <thread>
 #include <vector>
 #include <chrono>
-#include <atomic>
-#include <mutex>
 #include <cstdlib>
 #include <tcl.h>
 #include <tk.h>
 
+#include "../core/simulation.h"
+#include "../core/tk_loop.h"
+
 // Enum para los estados del semáforo
 enum TrafficLightState
 {
@@ -57,151 +58,158 @@ private:
   int offset;
 };
 
-// Clase Car para representar un coche
-class Car
+// Columnas de los coches (una por atributo de cada coche)
+enum CarColumn
 {
-public:
-  Car(int lane) : lane(lane), x(lane == 0 ? 0 : 200), y(lane == 1 ? 0 : 200), speed(rand() % 5 + 5) {}
+  Lane,
+  X,
+  Y,
+  Speed
+};
+
+typedef sim::AgentStorage<int, int, int, int> Cars;
+
+// Añadir un coche al carril dado con una velocidad aleatoria
+void addCar(Cars &cars, sim::Rng &rng, int lane)
+{
+  cars.push_back(lane, lane == 0 ? 0 : 200, lane == 1 ? 0 : 200, rng.between(5, 9));
+}
 
-  // Actualizar la posición del coche basado en el estado del semáforo y la posición del semáforo
-  void update(TrafficLightState trafficLightState, int lightPosition)
+// Actualizar la posición de un coche basado en el estado del semáforo y la posición del semáforo
+inline void updateCar(int lane, int &x, int &y, int speed, TrafficLightState trafficLightState, int lightPosition)
+{
+  bool hasReachedLight = (lane == 0 && x + speed >= lightPosition) || (lane == 1 && y + speed >= lightPosition);
+
+  int currentSpeed = speed;
+  if (trafficLightState == YELLOW)
   {
-    bool hasReachedLight = (lane == 0 && x + speed >= lightPosition) || (lane == 1 && y + speed >= lightPosition);
+    currentSpeed /= 2;
+  }
 
-    int currentSpeed = speed;
-    if (trafficLightState == YELLOW)
+  if (trafficLightState == GREEN || !hasReachedLight || (lane == 0 && x > lightPosition) || (lane == 1 && y > lightPosition))
+  {
+    if (lane == 0)
     {
-      currentSpeed /= 2;
+      x += currentSpeed;
     }
-
-    if (trafficLightState == GREEN || !hasReachedLight || (lane == 0 && x > lightPosition) || (lane == 1 && y > lightPosition))
+    else if (lane == 1)
     {
-      if (lane == 0)
-      {
-        x += currentSpeed;
-      }
-      else if (lane == 1)
-      {
-        y += currentSpeed;
-      }
+      y += currentSpeed;
     }
   }
+}
 
-  // Obtener la posición x del coche
-  int getX() const { return x; }
-
-  // Obtener la posición y del coche
-  int getY() const { return y; }
-
-private:
-  int lane;
-  int x;
-  int y;
-  int speed;
+// Estado de la simulación que la GUI necesita para dibujar
+struct Snapshot
+{
+  std::vector<TrafficLightState> lights;
+  std::vector<int> carX, carY;
 };
 
 // Estructura para contener los datos de la simulación
 struct SimulationData
 {
   std::vector<TrafficLight> trafficLights;
-  std::vector<Car> cars;
+  Cars cars;
   Tcl_Interp *interp; // Intérprete para la GUI
+
+  std::chrono::system_clock::time_point startTime;
+  sim::ThreadPool pool;
+  sim::Scheduler scheduler;
+  sim::BackgroundLoop loop;        // Hilo de la simulación
+  sim::SnapshotBuffer<Snapshot> published;
+  Snapshot next;                   // Se rellena en el hilo de la simulación
+  Snapshot drawn;                  // Se lee en el hilo de la GUI
+
+  SimulationData() : interp(NULL) {}
 };
 
-// Variables globales
-std::atomic<bool> simulationRunning(true);
-std::mutex mtx;
+// Tamaño de los bloques de coches que procesa cada hilo
+const std::size_t carGrain = 256;
 
-// Función para actualizar la simulación
-void updateSimulation(SimulationData *data)
+// Publicar el estado para la GUI
+void publishSnapshot(SimulationData &data)
 {
-  int startTime = std::chrono::system_clock::now().time_since_epoch() / std::chrono::seconds(1);
-
-  while (simulationRunning)
+  data.next.lights.clear();
+  for (const auto &light : data.trafficLights)
   {
+    data.next.lights.push_back(light.getState());
+  }
+  data.next.carX = data.cars.column<X>();
+  data.next.carY = data.cars.column<Y>();
+  data.published.publish(data.next);
+}
+
+// Fases de un paso de la simulación, en el orden en que se ejecutan
+void setupScheduler(SimulationData &data)
+{
+  data.scheduler.addPhase("lights", [&data](std::uint64_t)
+                          {
     int currentTime = std::chrono::system_clock::now().time_since_epoch() / std::chrono::seconds(1);
+    int startTime = data.startTime.time_since_epoch() / std::chrono::seconds(1);
     int elapsedTime = currentTime - startTime;
     int cycleTime = elapsedTime % 18;
 
+    for (auto &light : data.trafficLights)
     {
-      std::lock_guard<std::mutex> lock(mtx);
-
-      for (auto &light : data->trafficLights)
+      light.update(cycleTime);
+    } });
+
+  data.scheduler.addPhase("cars", [&data](std::uint64_t)
+                          {
+    const std::vector<int> &lanes = data.cars.column<Lane>();
+    std::vector<int> &xs = data.cars.column<X>();
+    std::vector<int> &ys = data.cars.column<Y>();
+    const std::vector<int> &speeds = data.cars.column<Speed>();
+    data.pool.parallelFor(data.cars.size(), carGrain, [&](std::size_t begin, std::size_t end, unsigned)
+                          {
+      for (std::size_t i = begin; i < end; ++i)
       {
-        light.update(cycleTime);
-      }
-
-      for (auto &car : data->cars)
-      {
-        TrafficLightState lightState = data->trafficLights[car.getX() < 150 ? 0 : 1].getState();
+        TrafficLightState lightState = data.trafficLights[xs[i] < 150 ? 0 : 1].getState();
         int lightPosition = 150;
-        car.update(lightState, lightPosition);
-      }
-    }
+        updateCar(lanes[i], xs[i], ys[i], speeds[i], lightState, lightPosition);
+      } }); });
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  }
+  data.scheduler.addPhase("snapshot", [&data](std::uint64_t)
+                          { publishSnapshot(data); });
 }
 
 // Función para actualizar la GUI
-void updateGUI(void *clientData)
+void updateGUI(SimulationData &data)
 {
-  SimulationData *data = reinterpret_cast<SimulationData *>(clientData);
-
-  std::lock_guard<std::mutex> lock(mtx);
+  data.published.read(data.drawn);
+  const Snapshot &snapshot = data.drawn;
 
   // Limpiar el canvas
-  Tcl_Eval(data->interp, ".canvas delete all");
+  Tcl_Eval(data.interp, ".canvas delete all");
 
   // Dibujar las carreteras
-  Tcl_Eval(data->interp, ".canvas create rectangle 0 200 400 200 -fill gray"); // Carretera horizontal
-  Tcl_Eval(data->interp, ".canvas create rectangle 200 0 200 400 -fill gray"); // Carretera vertical
+  Tcl_Eval(data.interp, ".canvas create rectangle 0 200 400 200 -fill gray"); // Carretera horizontal
+  Tcl_Eval(data.interp, ".canvas create rectangle 200 0 200 400 -fill gray"); // Carretera vertical
 
   // Dibujar los semáforos
-  for (size_t i = 0; i < data->trafficLights.size(); ++i)
+  for (size_t i = 0; i < snapshot.lights.size(); ++i)
   {
     int x = (i == 0 ? 150 : 200);
     int y = (i == 0 ? 200 : 150);
-    TrafficLightState state = data->trafficLights[i].getState();
+    TrafficLightState state = snapshot.lights[i];
     const char *color = (state == GREEN) ? "green" : (state == YELLOW) ? "yellow"
                                                                        : "red";
 
     std::string command = ".canvas create oval " + std::to_string(x) + " " + std::to_string(y) + " " +
                           std::to_string(x + 20) + " " + std::to_string(y + 20) + " -fill " + color;
-    Tcl_Eval(data->interp, command.c_str());
+    Tcl_Eval(data.interp, command.c_str());
   }
 
   // Dibujar los coches
-  for (const auto &car : data->cars)
+  for (size_t i = 0; i < snapshot.carX.size(); ++i)
   {
-    int x = car.getX();
-    int y = car.getY();
+    int x = snapshot.carX[i];
+    int y = snapshot.carY[i];
     std::string command = ".canvas create rectangle " + std::to_string(x) + " " + std::to_string(y) + " " +
                           std::to_string(x + 20) + " " + std::to_string(y + 10) + " -fill blue";
-    Tcl_Eval(data->interp, command.c_str());
+    Tcl_Eval(data.interp, command.c_str());
   }
-
-  // Programar la siguiente actualización
-  Tcl_CreateTimerHandler(100, updateGUI, clientData);
-}
-
-// Función para iniciar la simulación
-int startSimulation(void *clientData, Tcl_Interp *interp, int argc, const char *argv[])
-{
-  SimulationData *data = reinterpret_cast<SimulationData *>(clientData);
-  simulationRunning = true;
-  std::thread simulationThread(updateSimulation, data);
-  simulationThread.detach();
-  Tcl_SetResult(interp, const_cast<char *>("Simulacion comenzada"), TCL_STATIC);
-  return TCL_OK;
-}
-
-// Función para detener la simulación
-int stopSimulation(void *clientData, Tcl_Interp *interp, int argc, const char *argv[])
-{
-  simulationRunning = false;
-  Tcl_SetResult(interp, const_cast<char *>("Simulacion detenida"), TCL_STATIC);
-  return TCL_OK;
 }
 
 int main(int argc, char *argv[])
@@ -219,18 +227,33 @@ int main(int argc, char *argv[])
   }
 
   // Crear datos de la simulación
-  SimulationData data = {
-      {TrafficLight(10, 1, 7, GREEN, 0),
-       TrafficLight(10, 1, 7, RED, 9)},
-      {Car(0),
-       Car(1),
-       Car(0),
-       Car(1)},
-      interp};
-
-  // Crear comandos
-  Tcl_CreateCommand(interp, "startSimulation", startSimulation, reinterpret_cast<void *>(&data), NULL);
-  Tcl_CreateCommand(interp, "stopSimulation", stopSimulation, reinterpret_cast<void *>(&data), NULL);
+  SimulationData data;
+  data.interp = interp;
+  data.trafficLights = {TrafficLight(10, 1, 7, GREEN, 0),
+                        TrafficLight(10, 1, 7, RED, 9)};
+  sim::Rng rng(static_cast<std::uint64_t>(std::chrono::system_clock::now().time_since_epoch().count()));
+  addCar(data.cars, rng, 0);
+  addCar(data.cars, rng, 1);
+  addCar(data.cars, rng, 0);
+  addCar(data.cars, rng, 1);
+  setupScheduler(data);
+  publishSnapshot(data);
+
+  // Crear comandos; la simulación avanza en su propio hilo cada 100 ms mientras está en marcha
+  sim::TkLoop loop(interp, 100, true);
+  loop.addControlCommands("startSimulation", "stopSimulation", "Simulacion comenzada", "Simulacion detenida");
+  loop.setOnStart([&data]()
+                  {
+    // El hilo de la simulación lee startTime: solo se reinicia si está detenido
+    if (!data.loop.isRunning())
+    {
+      data.startTime = std::chrono::system_clock::now();
+      data.loop.start([&data]()
+                      { data.scheduler.step(); },
+                      std::chrono::milliseconds(100));
+    } });
+  loop.setOnStop([&data]()
+                 { data.loop.stop(); });
 
   if (Tk_MainWindow(interp) == NULL)
   {
@@ -246,10 +269,12 @@ int main(int argc, char *argv[])
   Tcl_Eval(interp, "pack .start .stop .canvas");
 
   // Programar actualizaciones de la GUI
-  Tcl_CreateTimerHandler(100, updateGUI, reinterpret_cast<void *>(&data));
+  loop.schedule([&data]()
+                { updateGUI(data); });
 
   // Iniciar el bucle principal de Tk
-  Tk_MainLoop();
+  loop.mainLoop();
+  data.loop.stop();
 
   return 0;
 }
\ No newline at end of file